@@ -1,13 +1,36 @@
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <iostream>
 #include "chip8.hpp"
 
 #define BG_COL sf::Color( 41,  43, 49, 255)
 #define PX_COL sf::Color(106, 202, 63, 255)
 
-Chip8::Chip8(unsigned ipc, bool isHighDpi)
-    : ipc(ipc), scale(isHighDpi ? 20U : 10U), isPaused(false)
+#define INPUT_SLICES    4  // Input polls per frame in low latency mode
+#define LATENCY_TIMEOUT 30 // Frames to wait for a key press to show
+#define RENDER_MARGIN   sf::microseconds(500)
+
+Chip8::Chip8(unsigned ipc, unsigned scale)
+    : debugger(vm),
+      ipc(ipc),
+      scale(scale),
+      isPaused(false),
+      printStats(false),
+      isDebugging(false),
+      isLowLatency(false),
+      isVsync(false),
+      isMeasuringLatency(false),
+      renderEstimate(sf::milliseconds(2)),
+      probe(),
+      latencyCount(0),
+      latencyTotal(0)
 {
     window.create(sf::VideoMode(64U * scale, 32U * scale), "Chip-8 interpreter");
+
+    // Held keys stay set in keyState, so repeats carry no information and
+    // would start latency measurements without any change in input
+    window.setKeyRepeatEnabled(false);
     initSound();
 }
 
@@ -35,59 +58,318 @@ void Chip8::initSound()
 void Chip8::run(const std::string& rom, bool withCompatibility)
 {
     if (!vm.loadProgram(rom)) return;
+    // Plain display unless a filter was set
+    if (!post && !setDisplayFilter(PostProcessor::Filter::Nearest, 0.0f)) return;
 
     window.setTitle(vm.programInfo().name);
     vm.useAltShiftLoadBehaviour(withCompatibility);
 
     const auto hz = sf::milliseconds(1000/60); // 60 Hz, 16.6 ms
     sf::Clock timer;
+    auto atVblank = false;
     for (;;)
     {
-        timer.restart();
+        // With vsync, display() paces the loop and the frame starts at the
+        // vblank it returned on
+        if (!atVblank) timer.restart();
+        atVblank = false;
+
+        if (!handleEvents()) return;
+        if (isDebugging) debugger.processCommands();
+        if (isPaused) goto sleep;
 
-        sf::Event event;
-        while (window.pollEvent(event))
+        if (debugger.isArmed())
         {
-            switch (event.type)
+            // Breakpoints are checked on a separate, slower path that is only
+            // taken while the debugger is armed
+            const auto frameDone = debugger.runFrame(ipc);
+            vm.isBuzzerOn() && !debugger.isStopped() ? buzzer.play() : buzzer.stop();
+            updateLatencyProbe();
+            if (!frameDone) goto present;
+        }
+        else
+        {
+            // IPC controls effective emulation speed, i.e. ipc*60 = inst/s.
+            // Insts already run towards an interrupted frame count towards it
+            const auto done  = debugger.takeFrameInsts();
+            const auto count = ipc - done;
+            if (isLowLatency)
             {
-            case sf::Event::Closed:
-                window.close();
-                return;
-
-            case sf::Event::KeyPressed:
-                onKeyDn(event);
-                break;
-
-            case sf::Event::KeyReleased:
-                onKeyUp(event);
-                break;
+                auto ran = 0U;
+                if (!runSliced(timer, hz, count, ran)) return;
 
-            default:
-                // Ignore other event types
-                break;
+                // Input between slices may have paused or broken into the
+                // debugger, in which case the frame is finished on resuming
+                if (isPaused || debugger.isStopped())
+                {
+                    debugger.addFrameInsts(done + ran);
+                    if (isPaused) goto sleep;
+                    goto present;
+                }
+            }
+            else
+            {
+                runInstructions(count);
             }
         }
 
-        if (isPaused) goto sleep;
+        vm.cycleTimers(); // Update timers at 60 Hz independent of IPC
 
-        // IPC controls effective emulation speed, i.e. ipc*60 = inst/s
-        for (auto i = 0U; i < ipc; i++)
+        present:
+
+        if (isLowLatency)
         {
-            vm.cycle();
-            vm.isBuzzerOn() ? buzzer.play() : buzzer.stop();
+            // Present just in time, leaving enough of the frame to render
+            sf::sleep(hz - renderEstimate - timer.getElapsedTime());
         }
 
-        vm.cycleTimers(); // Update timers at 60 Hz independent of IPC
+        {
+            // With vsync display() blocks until vblank, which is not render
+            // work, so it is left out of the estimate
+            const auto renderStart = timer.getElapsedTime();
+            window.clear(BG_COL);
+            drawFrame();
+            if (isVsync) updateRenderEstimate(timer.getElapsedTime() - renderStart, hz);
+            window.display();
+            if (!isVsync) updateRenderEstimate(timer.getElapsedTime() - renderStart, hz);
+        }
+        reportLatency();
 
-        window.clear(BG_COL);
-        drawFrame();
-        window.display();
+        if (isVsync)
+        {
+            timer.restart();
+            atVblank = true;
+            continue;
+        }
 
         sleep:
         sf::sleep(hz - timer.getElapsedTime()); // Only occurs if result > 0
     }
 }
 
+// Returns false once the window has been closed
+bool Chip8::handleEvents()
+{
+    // Events read now happened at some point since the previous poll
+    lastPoll = thisPoll;
+    thisPoll = latencyClock.getElapsedTime();
+
+    sf::Event event;
+    while (window.pollEvent(event))
+    {
+        switch (event.type)
+        {
+        case sf::Event::Closed:
+            window.close();
+            if (printStats) dumpStats();
+            return false;
+
+        case sf::Event::KeyPressed:
+            onKeyDn(event);
+            break;
+
+        case sf::Event::KeyReleased:
+            onKeyUp(event);
+            break;
+
+        default:
+            // Ignore other event types
+            break;
+        }
+    }
+    return true;
+}
+
+// A cycle may retire several instructions if they were fused
+void Chip8::runInstructions(unsigned count)
+{
+    for (auto i = 0U; i < count; )
+    {
+        i += vm.cycle(count - i);
+        vm.isBuzzerOn() ? buzzer.play() : buzzer.stop();
+    }
+    updateLatencyProbe();
+}
+
+// Low latency: the frame's insts are run in slices spread over the time
+// before the render deadline, with input polled before each slice. The last
+// slice starts at the deadline so no input arrives unread before present.
+// Returns false once the window has been closed. ran is set to the insts run,
+// which is fewer than count if input paused or broke between slices
+bool Chip8::runSliced(const sf::Clock& timer, sf::Time frameTime, unsigned count,
+                      unsigned& ran)
+{
+    const auto budget = frameTime - renderEstimate;
+    for (auto slice = 0U; slice < INPUT_SLICES; slice++)
+    {
+        if (slice > 0)
+        {
+            sf::sleep(budget * (float(slice) / (INPUT_SLICES - 1)) - timer.getElapsedTime());
+            if (!handleEvents()) return false;
+            if (isPaused || debugger.isStopped()) break;
+        }
+
+        const auto first = count * slice / INPUT_SLICES;
+        const auto last  = count * (slice + 1) / INPUT_SLICES;
+        runInstructions(last - first);
+        ran = last;
+    }
+    return true;
+}
+
+// Render time is tracked as a moving average so the just in time deadline
+// adapts to the filter and scale
+void Chip8::updateRenderEstimate(sf::Time elapsed, sf::Time frameTime)
+{
+    const auto estimate = renderEstimate * 0.9f + (elapsed + RENDER_MARGIN) * 0.1f;
+    renderEstimate = std::min(estimate, frameTime / 2.0f);
+}
+
+// With vsync the frame rate follows the display, which should be 60 Hz
+void Chip8::useLowLatency(bool enabled, bool vsync)
+{
+    isLowLatency = enabled;
+    isVsync      = vsync;
+    window.setVerticalSyncEnabled(vsync);
+}
+
+void Chip8::measureLatency(bool enabled)
+{
+    isMeasuringLatency = enabled;
+}
+
+// Starts a measurement when a mapped key is pressed. The press is only seen
+// when events are polled, so it is bounded by the previous poll and this one
+void Chip8::startLatencyProbe()
+{
+    if (!isMeasuringLatency || probe.isActive) return;
+
+    probe.isActive  = true;
+    probe.isChanged = false;
+    probe.keyTime   = lastPoll;
+    probe.readTime  = thisPoll;
+    probe.keyInsts  = vm.fusionStats().retired;
+    probe.frames    = 0;
+}
+
+// Called after insts have run; notes the first frame buffer change since the
+// key press. Wall time is taken at the end of the batch, so is an upper bound
+void Chip8::updateLatencyProbe()
+{
+    if (!probe.isActive || probe.isChanged) return;
+
+    const auto changedAt = vm.frameBufferChangedAt();
+    if (changedAt > probe.keyInsts)
+    {
+        probe.isChanged   = true;
+        probe.changeTime  = latencyClock.getElapsedTime();
+        probe.changeInsts = changedAt;
+    }
+}
+
+// Called after each present
+void Chip8::reportLatency()
+{
+    if (!probe.isActive) return;
+
+    if (!probe.isChanged)
+    {
+        // Not every key press changes the screen
+        if (++probe.frames > LATENCY_TIMEOUT) probe.isActive = false;
+        return;
+    }
+
+    probe.isActive = false;
+    const auto presentTime  = latencyClock.getElapsedTime();
+    const auto presentInsts = vm.fusionStats().retired;
+
+    // Best case from when the key was read, worst case from the poll before
+    const auto toChangeMin  = (probe.changeTime - probe.readTime).asMicroseconds();
+    const auto toChange     = (probe.changeTime - probe.keyTime).asMicroseconds();
+    const auto toPresentMin = (presentTime - probe.readTime).asMicroseconds();
+    const auto toPresent    = (presentTime - probe.keyTime).asMicroseconds();
+
+    latencyCount++;
+    latencyTotal += toPresent;
+
+    printf("Latency: key to change %llu inst / %lld-%lld us, to present %llu inst / %lld-%lld us\n",
+        probe.changeInsts - probe.keyInsts,
+        static_cast<long long>(toChangeMin), static_cast<long long>(toChange),
+        presentInsts - probe.keyInsts,
+        static_cast<long long>(toPresentMin), static_cast<long long>(toPresent));
+    fflush(stdout);
+
+    if (!isPaused)
+    {
+        char title[128];
+        snprintf(title, sizeof(title), "%s | latency %lld us (avg %lld us)",
+            vm.programInfo().name.c_str(), static_cast<long long>(toPresent),
+            static_cast<long long>(latencyTotal / latencyCount));
+        window.setTitle(title);
+    }
+}
+
+void Chip8::useMacroOpFusion(bool enabled)
+{
+    vm.useMacroOpFusion(enabled);
+}
+
+void Chip8::printStatsOnExit(bool enabled)
+{
+    printStats = enabled;
+}
+
+bool Chip8::enableTrace(const std::string& path, bool flightRecorder)
+{
+    return vm.enableTrace(path, flightRecorder);
+}
+
+// Reads debugger commands from stdin
+void Chip8::enableDebugger()
+{
+    isDebugging = true;
+    debugger.start();
+}
+
+// Persistence is the fraction of brightness a px keeps each frame after
+// turning off, which hides XOR flicker
+bool Chip8::setDisplayFilter(PostProcessor::Filter filter, float persistence)
+{
+    post.reset(new PostProcessor(scale, filter, persistence,
+                                 BG_COL.toInteger(), PX_COL.toInteger()));
+    if (!texture.create(post->width(), post->height()))
+    {
+        std::cerr << "Unable to create " << post->width() << "x"
+                  << post->height() << " display texture" << std::endl;
+        post.reset();
+        return false;
+    }
+    sprite.setTexture(texture, true);
+    return true;
+}
+
+// Largest scale the display texture supports on this GPU
+unsigned Chip8::maxScale()
+{
+    return sf::Texture::getMaximumSize() / 64U;
+}
+
+void Chip8::dumpStats() const
+{
+    const auto& stats = vm.fusionStats();
+    const auto pct = [&stats](unsigned long long n) {
+        return stats.retired > 0 ? 100.0 * n / stats.retired : 0.0;
+    };
+
+    printf("Instructions retired: %llu\n", stats.retired);
+    printf("Fused: %llu (%.1f%%)\n", stats.fused, pct(stats.fused));
+    for (auto i = 0; i < Interpreter::FusedOpCount; i++)
+    {
+        const auto op = static_cast<Interpreter::FusedOp>(i);
+        printf("  %-20s %llu\n", Interpreter::fusedOpName(op), stats.hits[i]);
+    }
+}
+
 void Chip8::onKeyDn(const sf::Event& event)
 {
     if (!isPaused)
@@ -96,6 +378,7 @@ void Chip8::onKeyDn(const sf::Event& event)
         if (key != Keymap.end())
         {
             vm.setKeyState(key->second, true);
+            startLatencyProbe();
         }
     }
 }
@@ -129,36 +412,28 @@ void Chip8::onKeyUp(const sf::Event& event)
         window.setTitle(vm.programInfo().name);
         vm.reset();
     }
-}
 
-void Chip8::drawFrame()
-{
-    const auto& frame = vm.frameBuffer();
-    sf::VertexArray vertices(sf::Quads, frame.Width * frame.Height * 4);
-
-    for (auto y = 0; y < frame.Height; y++)
+    // Ctrl+B: break into debugger
+    if (isDebugging &&
+        event.key.control &&
+        event.key.code == sf::Keyboard::B)
     {
-        // i = pixel index
-        for (auto x = 0, i = y * frame.Width;
-             x < frame.Width;
-             x++, i = x + y * frame.Width)
-        {
-            auto px = frame.pixels + i;
-            if (*px == 1) // Only process pixels that are 'on'
-            {
-                auto quad = &vertices[i * 4];
-
-                quad[0].position = sf::Vector2f(float(x*scale),       float(y*scale));
-                quad[1].position = sf::Vector2f(float(x*scale+scale), float(y*scale));
-                quad[2].position = sf::Vector2f(float(x*scale+scale), float(y*scale+scale));
-                quad[3].position = sf::Vector2f(float(x*scale),       float(y*scale+scale));
+        buzzer.stop();
+        debugger.breakNow();
+    }
 
-                quad[0].color = PX_COL;
-                quad[1].color = PX_COL;
-                quad[2].color = PX_COL;
-                quad[3].color = PX_COL;
-            }
-        }
+    // Ctrl+T: write flight recorder trace
+    if (event.key.control &&
+        event.key.code == sf::Keyboard::T)
+    {
+        if (vm.dumpTrace()) printf("Trace written\n");
     }
-    window.draw(vertices);
+}
+
+// Post-process on the CPU and present the result as a single texture
+void Chip8::drawFrame()
+{
+    post->process(vm.frameBuffer());
+    texture.update(post->pixels());
+    window.draw(sprite);
 }
@@ -6,13 +6,23 @@
 #include <SFML/Window.hpp>
 #include <SFML/Audio.hpp>
 #include <SFML/Graphics.hpp>
+#include "debugger.hpp"
 #include "interpreter.hpp"
+#include "postprocess.hpp"
 
 class Chip8
 {
 public:
-    explicit Chip8(unsigned ipc, bool isHighDpi);
+    explicit Chip8(unsigned ipc, unsigned scale);
     void run(const std::string& rom, bool withCompatibility);
+    void useMacroOpFusion(bool enabled);
+    void printStatsOnExit(bool enabled);
+    bool enableTrace(const std::string& path, bool flightRecorder);
+    void enableDebugger();
+    bool setDisplayFilter(PostProcessor::Filter filter, float persistence);
+    void useLowLatency(bool enabled, bool vsync);
+    void measureLatency(bool enabled);
+    static unsigned maxScale();
 
 private:
     // Map SFML key codes to Chip-8 hex keypad
@@ -36,18 +46,56 @@ private:
         { sf::Keyboard::Key::V,    0xF }
     };
 
+    // Tracks one key press through to the screen
+    struct LatencyProbe
+    {
+        bool isActive;
+        bool isChanged; // Frame buffer has changed since the key press
+        unsigned frames;
+        sf::Time keyTime;  // Previous poll, the earliest the key was pressed
+        sf::Time readTime; // Poll that read the key press
+        sf::Time changeTime;
+        unsigned long long keyInsts;    // Insts retired at key press
+        unsigned long long changeInsts; // Insts retired at first change
+    };
+
     Interpreter vm;
+    Debugger debugger;
     sf::RenderWindow window;
+    std::unique_ptr<PostProcessor> post;
+    sf::Texture texture;
+    sf::Sprite sprite;
     sf::SoundBuffer buzzerBuffer;
     sf::Sound buzzer;
     unsigned ipc; // Instructions per cycle
     unsigned scale;
     bool isPaused;
+    bool printStats;
+    bool isDebugging;
+    bool isLowLatency;
+    bool isVsync;
+    bool isMeasuringLatency;
+    sf::Time renderEstimate;
+    sf::Clock latencyClock;
+    sf::Time lastPoll; // Time of the poll before the current one
+    sf::Time thisPoll;
+    LatencyProbe probe;
+    unsigned latencyCount;
+    long long latencyTotal; // us
 
+    bool handleEvents();
+    void runInstructions(unsigned count);
+    bool runSliced(const sf::Clock& timer, sf::Time frameTime, unsigned count,
+                   unsigned& ran);
+    void updateRenderEstimate(sf::Time elapsed, sf::Time frameTime);
+    void startLatencyProbe();
+    void updateLatencyProbe();
+    void reportLatency();
     void onKeyDn(const sf::Event& event);
     void onKeyUp(const sf::Event& event);
     void drawFrame();
     void initSound();
+    void dumpStats() const;
 };
 
 #endif // CHIP8_H_
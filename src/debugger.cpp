@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include "debugger.hpp"
+
+Debugger::Debugger(Interpreter& vm)
+    : vm(vm),
+      console(std::make_shared<Console>()),
+      frameInsts(0),
+      pendingSteps(0),
+      stopped(false),
+      skipBreakpoint(false),
+      armed(false)
+{
+}
+
+// Starts reading commands from stdin
+void Debugger::start()
+{
+    const auto shared = console;
+    std::thread([shared]()
+    {
+        std::string line;
+        while (std::getline(std::cin, line))
+        {
+            std::lock_guard<std::mutex> guard(shared->lock);
+            shared->lines.push_back(line);
+        }
+    }).detach();
+
+    printf("Debugger ready. Type h for help\n");
+}
+
+// Runs any commands received since the last frame
+void Debugger::processCommands()
+{
+    std::deque<std::string> lines;
+    {
+        std::lock_guard<std::mutex> guard(console->lock);
+        lines.swap(console->lines);
+    }
+
+    for (const auto& line : lines) execute(line);
+    fflush(stdout);
+}
+
+// Instrumented path: runs up to a frame's worth of insts, checking
+// breakpoints and watchpoints. Returns true once a full frame of insts has
+// run, i.e. when timers should be updated
+bool Debugger::runFrame(unsigned ipc)
+{
+    while (!stopped && frameInsts < ipc)
+    {
+        const auto pc = vm.pc();
+        if (breakpoints[pc] && !skipBreakpoint)
+        {
+            stop("breakpoint");
+            break;
+        }
+        skipBreakpoint = false;
+
+        const auto addr = vm.cycleWatched(watchpoints);
+        frameInsts++;
+
+        if (addr >= 0)
+        {
+            printf("Watchpoint 0x%04x written by inst @ 0x%04x\n", addr, pc);
+            vm.dumpMemory(2, addr & ~1);
+            stop("watchpoint");
+        }
+        else if (pendingSteps > 0 && --pendingSteps == 0)
+        {
+            stop("step");
+        }
+    }
+
+    if (frameInsts < ipc) return false;
+    frameInsts = 0;
+    return true;
+}
+
+// Insts run towards a frame that was not finished before disarming or
+// pausing. The frontend runs only the rest of that frame so timers stay in step
+unsigned Debugger::takeFrameInsts()
+{
+    const auto insts = frameInsts;
+    frameInsts = 0;
+    return insts;
+}
+
+// Insts the frontend ran towards a frame before it was interrupted, so the
+// rest of the frame is run once it resumes on either path
+void Debugger::addFrameInsts(unsigned insts)
+{
+    frameInsts += insts;
+}
+
+void Debugger::breakNow()
+{
+    if (!stopped) stop("break");
+}
+
+// Whether the frontend must use the instrumented path
+bool Debugger::isArmed() const
+{
+    return armed;
+}
+
+bool Debugger::isStopped() const
+{
+    return stopped;
+}
+
+void Debugger::execute(const std::string& command)
+{
+    std::istringstream args(command);
+    std::string cmd, arg1, arg2;
+    args >> cmd >> arg1 >> arg2;
+    if (cmd.empty()) return;
+
+    try
+    {
+        // Addresses are hex, counts are decimal
+        const auto addr = arg1.empty()
+            ? 0UL : std::stoul(arg1, nullptr, 16) % MEMORY_SIZE;
+
+        if (cmd == "b" && !arg1.empty())
+        {
+            breakpoints.set(addr);
+        }
+        else if (cmd == "w" && !arg1.empty())
+        {
+            const auto len = arg2.empty() ? 1UL : std::stoul(arg2);
+            for (auto i = addr; i < addr + len && i < MEMORY_SIZE; i++)
+            {
+                watchpoints.set(i);
+            }
+        }
+        else if (cmd == "d" && !arg1.empty())
+        {
+            breakpoints.reset(addr);
+            watchpoints.reset(addr);
+        }
+        else if (cmd == "l")
+        {
+            listPoints();
+        }
+        else if (cmd == "c")
+        {
+            resume(0);
+        }
+        else if (cmd == "s")
+        {
+            resume(arg1.empty() ? 1U : unsigned(std::stoul(arg1)));
+        }
+        else if (cmd == "p")
+        {
+            breakNow();
+        }
+        else if (cmd == "r")
+        {
+            printf("PC: 0x%04x\n", vm.pc());
+            vm.dumpRegisters();
+        }
+        else if (cmd == "k")
+        {
+            vm.dumpStack();
+        }
+        else if (cmd == "m" && !arg1.empty())
+        {
+            // dumpMemory prints 2 bytes per line and takes at most 254
+            const auto len = arg2.empty() ? 16UL : std::stoul(arg2);
+            const auto end = std::min(addr + std::min(len, 254UL),
+                                      static_cast<unsigned long>(MEMORY_SIZE));
+            vm.dumpMemory(static_cast<Interpreter::u8>((end - addr) & ~1UL),
+                          static_cast<Interpreter::u16>(addr));
+        }
+        else if (cmd == "h")
+        {
+            printHelp();
+        }
+        else
+        {
+            printf("Unknown command '%s'. Type h for help\n", command.c_str());
+        }
+    }
+    catch (const std::logic_error&)
+    {
+        // Thrown by std::stoul on malformed numbers
+        printf("Invalid number in '%s'\n", command.c_str());
+    }
+
+    updateArmed();
+}
+
+void Debugger::stop(const char* reason)
+{
+    stopped      = true;
+    pendingSteps = 0;
+    updateArmed();
+
+    printf("Stopped @ 0x%04x (%s)\n", vm.pc(), reason);
+    vm.dumpMemory(2, vm.pc());
+    fflush(stdout);
+}
+
+// Continues execution, stopping again after steps insts if non-zero
+void Debugger::resume(unsigned steps)
+{
+    skipBreakpoint = stopped;
+    stopped        = false;
+    pendingSteps   = steps;
+    updateArmed();
+}
+
+void Debugger::updateArmed()
+{
+    armed = stopped || pendingSteps > 0 ||
+            breakpoints.any() || watchpoints.any();
+}
+
+void Debugger::listPoints() const
+{
+    printf("Breakpoints\n");
+    for (auto i = 0; i < MEMORY_SIZE; i++)
+    {
+        if (breakpoints[i]) printf("  0x%04x\n", i);
+    }
+
+    printf("Watchpoints\n");
+    for (auto i = 0; i < MEMORY_SIZE; i++)
+    {
+        if (watchpoints[i]) printf("  0x%04x\n", i);
+    }
+}
+
+void Debugger::printHelp() const
+{
+    printf("Commands (addresses in hex)\n"
+           "  b ADDR        Set breakpoint at ADDR\n"
+           "  w ADDR [LEN]  Watch LEN bytes from ADDR for writes\n"
+           "  d ADDR        Delete breakpoint/watchpoint at ADDR\n"
+           "  l             List breakpoints and watchpoints\n"
+           "  c             Continue\n"
+           "  s [N]         Step N insts (default 1)\n"
+           "  p             Break\n"
+           "  r             Show registers\n"
+           "  k             Show stack\n"
+           "  m ADDR [N]    Show N bytes of memory from ADDR (default 16)\n"
+           "  h             Show this help\n");
+}
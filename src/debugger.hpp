@@ -0,0 +1,54 @@
+#ifndef DEBUGGER_H_
+#define DEBUGGER_H_
+
+#include <bitset>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "interpreter.hpp"
+
+// Interactive debugger driven by text commands on stdin. While no
+// breakpoints or watchpoints are set the frontend runs the interpreter
+// directly; runFrame() is the instrumented path used only while armed
+class Debugger
+{
+  public:
+    explicit Debugger(Interpreter& vm);
+    void start();
+    void processCommands();
+    bool runFrame(unsigned ipc);
+    unsigned takeFrameInsts();
+    void addFrameInsts(unsigned insts);
+    void breakNow();
+    bool isArmed() const;
+    bool isStopped() const;
+
+  private:
+    // Lines read from stdin; shared with the reader thread, which may
+    // outlive the debugger as it blocks on input
+    struct Console
+    {
+        std::mutex lock;
+        std::deque<std::string> lines;
+    };
+
+    Interpreter& vm;
+    std::shared_ptr<Console> console;
+    std::bitset<MEMORY_SIZE> breakpoints;
+    std::bitset<MEMORY_SIZE> watchpoints;
+    unsigned frameInsts;   // Insts run towards the current frame
+    unsigned pendingSteps; // Insts left to run before stopping, if stepping
+    bool stopped;
+    bool skipBreakpoint;   // Resuming from a breakpoint at the current PC
+    bool armed;
+
+    void execute(const std::string& command);
+    void stop(const char* reason);
+    void resume(unsigned steps);
+    void updateArmed();
+    void listPoints() const;
+    void printHelp() const;
+};
+
+#endif // DEBUGGER_H_
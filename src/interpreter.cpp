@@ -10,6 +10,10 @@
 #define PROG_START_ADDR 0x200 // Most programs start at 0x200 (512)
 
 Interpreter::Interpreter()
+    : altShiftLoad(false),
+      macroOpFusion(true),
+      frameCount(0),
+      bufferChangedAt(0)
 {
     loadFontSprites();
     reset();
@@ -75,16 +79,55 @@ bool Interpreter::loadProgram(const std::string& program)
     return true;
 }
 
-void Interpreter::cycle()
+// Executes the next instruction, or a fused sequence of up to maxInsts
+// instructions. Returns the number of instructions retired
+unsigned Interpreter::cycle(unsigned maxInsts)
 {
-    const u16 inst = mem[programCounter] << 8 | mem[programCounter + 1];
+    const u16 inst = fetch(programCounter);
+    if (macroOpFusion && maxInsts > 1)
+    {
+        const auto retired = executeFused(inst, maxInsts);
+        if (retired > 0)
+        {
+            stats.retired += retired;
+            stats.fused   += retired;
+            return retired;
+        }
+    }
+
+    const u16 pc = programCounter;
     programCounter += 2;
     execute(inst);
+    if (tracer) trace(pc, inst);
+    stats.retired++;
+    return 1;
+}
+
+// Instrumented single step used while debugging; never fuses. Returns the
+// first address in watchpoints written by the inst, or -1
+int Interpreter::cycleWatched(const std::bitset<MEMORY_SIZE>& watchpoints)
+{
+    const u16 inst = fetch(programCounter);
+    const u16 addr = registersI;
+
+    // Only Fx33 and Fx55 write to memory
+    auto len = 0;
+    if ((inst & 0xF0FF) == 0xF033) len = 3;
+    if ((inst & 0xF0FF) == 0xF055) len = ((inst & 0x0F00) >> 8) + 1;
+
+    cycle();
+
+    for (auto i = addr; i < addr + len && i < MEMORY_SIZE; i++)
+    {
+        if (watchpoints[i]) return i;
+    }
+    return -1;
 }
 
 // Timers should be decremented at 60 Hz
 void Interpreter::cycleTimers()
 {
+    frameCount++;
     if (registersDT > 0) registersDT--;
     if (registersST > 0) registersST--;
 }
@@ -95,6 +138,31 @@ void Interpreter::useAltShiftLoadBehaviour(bool enabled)
     altShiftLoad = enabled;
 }
 
+// Fused ops retire the same instructions with the same results, so this
+// only changes how many dispatches a given sequence takes
+void Interpreter::useMacroOpFusion(bool enabled)
+{
+    macroOpFusion = enabled;
+}
+
+// Flight recorder traces are only written on dumpTrace() or a fault
+bool Interpreter::enableTrace(const std::string& path, bool flightRecorder)
+{
+    tracer.reset(new Tracer());
+    if (!tracer->open(path, flightRecorder ? Tracer::Mode::FlightRecorder
+                                           : Tracer::Mode::Stream))
+    {
+        tracer.reset();
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::dumpTrace()
+{
+    return tracer && tracer->snapshot();
+}
+
 void Interpreter::setKeyState(u8 hexKeyCode, bool pressed)
 {
     keyState[hexKeyCode & 0xF] = pressed;
@@ -115,6 +183,36 @@ const Interpreter::FrameBuffer& Interpreter::frameBuffer() const
     return buffer;
 }
 
+const Interpreter::FusionStats& Interpreter::fusionStats() const
+{
+    return stats;
+}
+
+// Number of insts retired up to and including the last one that drew to
+// or cleared the frame buffer
+unsigned long long Interpreter::frameBufferChangedAt() const
+{
+    return bufferChangedAt;
+}
+
+Interpreter::u16 Interpreter::pc() const
+{
+    return programCounter;
+}
+
+const char* Interpreter::fusedOpName(FusedOp op)
+{
+    switch (op)
+    {
+    case FusedDraw:    return "Annn Dxyn";
+    case FusedSetPair: return "6xnn 6ynn";
+    case FusedLoop:    return "7xnn 3ynn 1nnn";
+    case FusedLoad:    return "Annn Fx65";
+    case FusedBcdDraw: return "Fx33 Fx65 Fx29 Dxyn";
+    default:           return "?";
+    }
+}
+
 void Interpreter::loadFontSprites()
 {
     // Each digit is represented by 5 bytes
@@ -141,6 +239,11 @@ void Interpreter::loadFontSprites()
     std::copy(font, font + sizeof(font), mem);
 }
 
+Interpreter::u16 Interpreter::fetch(u16 addr) const
+{
+    return mem[addr] << 8 | mem[addr + 1];
+}
+
 void Interpreter::execute(u16 instruction)
 {
     // Decode instruction
@@ -154,6 +257,7 @@ void Interpreter::execute(u16 instruction)
     if (instruction == 0x00E0)
     {
         std::fill(std::begin(buffer.pixels), std::end(buffer.pixels), 0);
+        bufferChangedAt = stats.retired + 1;
     }
     // 00EE: Return from subroutine
     else if (instruction == 0x00EE)
@@ -290,6 +394,7 @@ void Interpreter::execute(u16 instruction)
     else if ((instruction & 0xF000) == 0xD000)
     {
         drawToBuffer(x, y, n);
+        bufferChangedAt = stats.retired + 1;
     }
     // Ex9E: Skip next inst if key == Vx is pressed
     else if ((instruction & 0xF0FF) == 0xE09E)
@@ -343,9 +448,7 @@ void Interpreter::execute(u16 instruction)
     // Fx33: Set register I, I+1, I+2 = binary-coded decimal of Vx
     else if ((instruction & 0xF0FF) == 0xF033)
     {
-        mem[registersI]     = registersV[x] / 100;
-        mem[registersI + 1] = registersV[x] % 100 / 10;
-        mem[registersI + 2] = registersV[x] % 100 % 10;
+        storeBcd(x);
     }
     // Fx55: Store V0..Vx in mem starting at address in register I
     else if ((instruction & 0xF0FF) == 0xF055)
@@ -359,23 +462,125 @@ void Interpreter::execute(u16 instruction)
     // Fx65: Fill V0..Vx from mem starting at address in register I
     else if ((instruction & 0xF0FF) == 0xF065)
     {
-        for (auto i = 0; i <= x; i++)
-        {
-            registersV[i] = mem[registersI + i];
-        }
-        if (!altShiftLoad) registersI += x + 1;
+        loadRegisters(x);
     }
     else
     {
         printf("Unrecognised instruction @ 0x%04x: %04X\n",
             programCounter - 2, instruction);
 
+        if (tracer)
+        {
+            // exit() skips destructors, so flush the trace here
+            trace(programCounter - 2, instruction);
+            if (tracer->snapshot())
+            {
+                printf("Trace written to '%s'\n", tracer->path().c_str());
+            }
+            tracer->close();
+        }
+
         dumpRegisters();
         dumpMemory(16, programCounter - 2);
         exit(1);
     }
 }
 
+// Peephole pass over the instructions at PC. Recognised idioms are run as a
+// single op with the same architectural effect as executing them one by
+// one. Returns the number of instructions retired, or 0 if nothing matched
+unsigned Interpreter::executeFused(u16 instruction, unsigned maxInsts)
+{
+    const u16 pc = programCounter;
+    if (pc + 4 > MEMORY_SIZE) return 0;
+
+    const u16 next = fetch(pc + 2);
+
+    // Annn; Dxyn: Point I at a sprite and draw it
+    if ((instruction & 0xF000) == 0xA000 && (next & 0xF000) == 0xD000)
+    {
+        registersI = instruction & 0x0FFF;
+        if (tracer) trace(pc, instruction);
+        drawToBuffer((next & 0x0F00) >> 8, (next & 0x00F0) >> 4, next & 0x000F);
+        bufferChangedAt = stats.retired + 2;
+        if (tracer) trace(pc + 2, next);
+        programCounter = pc + 4;
+        stats.hits[FusedDraw]++;
+        return 2;
+    }
+    // Annn; Fx65: Point I at a table and load V0..Vx from it
+    if ((instruction & 0xF000) == 0xA000 && (next & 0xF0FF) == 0xF065)
+    {
+        registersI = instruction & 0x0FFF;
+        if (tracer) trace(pc, instruction);
+        loadRegisters((next & 0x0F00) >> 8);
+        if (tracer) trace(pc + 2, next);
+        programCounter = pc + 4;
+        stats.hits[FusedLoad]++;
+        return 2;
+    }
+    // 6xnn; 6ynn: Register setup
+    if ((instruction & 0xF000) == 0x6000 && (next & 0xF000) == 0x6000)
+    {
+        registersV[(instruction & 0x0F00) >> 8] = instruction & 0x00FF;
+        if (tracer) trace(pc, instruction);
+        registersV[(next & 0x0F00) >> 8] = next & 0x00FF;
+        if (tracer) trace(pc + 2, next);
+        programCounter = pc + 4;
+        stats.hits[FusedSetPair]++;
+        return 2;
+    }
+
+    if (maxInsts < 3 || pc + 6 > MEMORY_SIZE) return 0;
+
+    // 7xnn; 3ynn; 1nnn: Counted loop. The jump is skipped once Vy == nn
+    const u16 jump = fetch(pc + 4);
+    if ((instruction & 0xF000) == 0x7000 &&
+        (next & 0xF000) == 0x3000 &&
+        (jump & 0xF000) == 0x1000)
+    {
+        registersV[(instruction & 0x0F00) >> 8] += instruction & 0x00FF;
+        if (tracer) trace(pc, instruction);
+        if (tracer) trace(pc + 2, next);
+        stats.hits[FusedLoop]++;
+        if (registersV[(next & 0x0F00) >> 8] == (next & 0x00FF))
+        {
+            programCounter = pc + 6;
+            return 2;
+        }
+        if (tracer) trace(pc + 4, jump);
+        programCounter = jump & 0x0FFF;
+        return 3;
+    }
+
+    if (maxInsts < 4 || pc + 8 > MEMORY_SIZE) return 0;
+
+    // Fx33; Fx65; Fx29; Dxyn: Convert to BCD and draw a digit. Not fused if
+    // the BCD store would overwrite the instructions that follow it
+    const u16 font = fetch(pc + 6);
+    if ((instruction & 0xF0FF) == 0xF033 &&
+        (next & 0xF0FF) == 0xF065 &&
+        (jump & 0xF0FF) == 0xF029 &&
+        (font & 0xF000) == 0xD000 &&
+        (registersI + 3 <= pc + 2 || registersI >= pc + 8))
+    {
+        storeBcd((instruction & 0x0F00) >> 8);
+        if (tracer) trace(pc, instruction);
+        loadRegisters((next & 0x0F00) >> 8);
+        if (tracer) trace(pc + 2, next);
+        registersI = registersV[(jump & 0x0F00) >> 8] * 5;
+        if (tracer) trace(pc + 4, jump);
+        drawToBuffer((font & 0x0F00) >> 8, (font & 0x00F0) >> 4, font & 0x000F);
+        bufferChangedAt = stats.retired + 4;
+        if (tracer) trace(pc + 6, font);
+        programCounter = pc + 8;
+        stats.hits[FusedBcdDraw]++;
+        return 4;
+    }
+
+    return 0;
+}
+
 void Interpreter::drawToBuffer(u8 x, u8 y, u8 n)
 {
     registersV[0xF] = 0;
@@ -408,6 +613,55 @@ void Interpreter::drawToBuffer(u8 x, u8 y, u8 n)
     }
 }
 
+void Interpreter::storeBcd(u8 x)
+{
+    mem[registersI]     = registersV[x] / 100;
+    mem[registersI + 1] = registersV[x] % 100 / 10;
+    mem[registersI + 2] = registersV[x] % 100 % 10;
+}
+
+void Interpreter::loadRegisters(u8 x)
+{
+    for (auto i = 0; i <= x; i++)
+    {
+        registersV[i] = mem[registersI + i];
+    }
+    if (!altShiftLoad) registersI += x + 1;
+}
+
+// Records a retired inst along with the register it wrote, if any
+void Interpreter::trace(u16 pc, u16 instruction)
+{
+    const u8 x  = (instruction & 0x0F00) >> 8;
+    const u8 nn =  instruction & 0x00FF;
+
+    u8 reg = Tracer::NoRegister;
+    switch (instruction & 0xF000)
+    {
+    case 0x6000:
+    case 0x7000:
+    case 0x8000:
+    case 0xC000:
+        reg = x;
+        break;
+    case 0xD000:
+        reg = 0xF;
+        break;
+    case 0xF000:
+        if (nn == 0x07 || nn == 0x0A || nn == 0x65) reg = x;
+        break;
+    }
+
+    tracer->record({
+        frameCount,
+        pc,
+        instruction,
+        registersI,
+        reg,
+        reg == Tracer::NoRegister ? u8(0) : registersV[reg]
+    });
+}
+
 void Interpreter::dumpRegisters() const
 {
     printf("Registers\n");
@@ -420,6 +674,15 @@ void Interpreter::dumpRegisters() const
     printf("  ST: %X\n", registersST);
 }
 
+void Interpreter::dumpStack() const
+{
+    printf("Stack (%d entries)\n", stackPointer);
+    for (auto i = stackPointer; i > 0; i--)
+    {
+        printf("  %2d: 0x%04x\n", i - 1, stack[i - 1]);
+    }
+}
+
 void Interpreter::dumpMemory(u8 bytes, u16 offset) const
 {
     printf("Memory (%d bytes)\n", bytes);
@@ -1,7 +1,10 @@
 #ifndef INTERPRETER_H_
 #define INTERPRETER_H_
 
+#include <bitset>
+#include <memory>
 #include <string>
+#include "tracer.hpp"
 
 #define MEMORY_SIZE 4096
 
@@ -25,20 +28,50 @@ class Interpreter
         u8 pixels[Width * Height];
     };
 
+    // Instruction idioms that are executed as a single fused op
+    enum FusedOp
+    {
+        FusedDraw,     // Annn; Dxyn
+        FusedSetPair,  // 6xnn; 6ynn
+        FusedLoop,     // 7xnn; 3ynn; 1nnn
+        FusedLoad,     // Annn; Fx65
+        FusedBcdDraw,  // Fx33; Fx65; Fx29; Dxyn
+        FusedOpCount
+    };
+
+    struct FusionStats
+    {
+        unsigned long long retired; // Total instructions retired
+        unsigned long long fused;   // Instructions retired by fused ops
+        unsigned long long hits[FusedOpCount];
+    };
+
     Interpreter();
     void reset();
     bool loadProgram(const std::string& program);
-    void cycle();
+    unsigned cycle(unsigned maxInsts = 1);
+    int cycleWatched(const std::bitset<MEMORY_SIZE>& watchpoints);
     void cycleTimers();
     void useAltShiftLoadBehaviour(bool enabled);
+    void useMacroOpFusion(bool enabled);
+    bool enableTrace(const std::string& path, bool flightRecorder);
+    bool dumpTrace();
     void setKeyState(u8 hexKeyCode, bool pressed);
     bool isBuzzerOn() const;
     const ProgramInfo& programInfo() const;
     const FrameBuffer& frameBuffer() const;
+    const FusionStats& fusionStats() const;
+    unsigned long long frameBufferChangedAt() const;
+    u16 pc() const;
+    void dumpRegisters() const;
+    void dumpStack() const;
+    void dumpMemory(u8 bytes, u16 offset = 0) const;
+    static const char* fusedOpName(FusedOp op);
 
   private:
     bool keyState[16];
     bool altShiftLoad;
+    bool macroOpFusion;
     ProgramInfo progInfo;
     FrameBuffer buffer;
 
@@ -50,12 +83,19 @@ class Interpreter
     u8  stackPointer;
     u16 stack[16];
     u16 programCounter;
+    FusionStats stats{};
+    unsigned frameCount;
+    unsigned long long bufferChangedAt; // Insts retired at last draw
+    std::unique_ptr<Tracer> tracer;
 
     void loadFontSprites();
+    u16  fetch(u16 addr) const;
     void execute(u16 instruction);
+    unsigned executeFused(u16 instruction, unsigned maxInsts);
     void drawToBuffer(u8 x, u8 y, u8 n);
-    void dumpRegisters() const;
-    void dumpMemory(u8 bytes, u16 offset = 0) const;
+    void storeBcd(u8 x);
+    void loadRegisters(u8 x);
+    void trace(u16 pc, u16 instruction);
 };
 
 #endif // INTERPRETER_H_
@@ -15,8 +15,25 @@ int main(int argc, char** argv)
     options.add_options()
         ("i,ipc",       "Instructions to execute per cycle", CXX_UINT(9), "IPC")
         ("r,high-dpi",  "Scale window for high DPI displays")
+        ("x,scale",     "Scale window by N. Overrides --high-dpi",
+                        cxxopts::value<unsigned>(), "N")
+        ("f,filter",    "Display filter: nearest, scanline or crt",
+                        cxxopts::value<std::string>()->default_value("nearest"),
+                        "NAME")
+        ("p,persistence", "Fraction of brightness px keep each frame after "
+                        "turning off (0-1). Reduces flicker",
+                        cxxopts::value<float>()->default_value("0"), "P")
         ("c,compat",    "Enable alternative shift and load behaviour. "
                         "May be required for some ROMs to work correctly")
+        ("no-fusion",   "Disable fusing of common instruction sequences")
+        ("s,stats",     "Print execution statistics on exit")
+        ("t,trace",     "Write a binary execution trace to FILE",
+                        cxxopts::value<std::string>(), "FILE")
+        ("flight-recorder", "Only write the trace on a fault or Ctrl+T")
+        ("d,debug",     "Accept debugger commands on stdin")
+        ("l,low-latency", "Poll input during the frame and present just in time")
+        ("vsync",       "Enable vertical sync")
+        ("latency",     "Measure and log input-to-screen latency")
         ("h,help",      "Print help");
 
     options.add_options("hidden")
@@ -34,8 +51,44 @@ int main(int argc, char** argv)
             return 0;
         }
 
+        PostProcessor::Filter filter;
+        if (!PostProcessor::parseFilter(result["filter"].as<std::string>(), filter))
+        {
+            std::cerr << "Unknown filter '" << result["filter"].as<std::string>()
+                      << "'. Use -h or --help to see valid options" << std::endl;
+            return 1;
+        }
+
+        const auto scale = result.count("scale")
+            ? result["scale"].as<unsigned>()
+            : result.count("high-dpi") ? 20U : 10U;
+
+        if (scale == 0 || scale > Chip8::maxScale())
+        {
+            std::cerr << "Scale must be between 1 and " << Chip8::maxScale()
+                      << std::endl;
+            return 1;
+        }
+
         // Init the interpreter
-        Chip8 interpreter(result["ipc"].as<unsigned>(), result.count("high-dpi"));
+        Chip8 interpreter(result["ipc"].as<unsigned>(), scale);
+        if (!interpreter.setDisplayFilter(filter, result["persistence"].as<float>()))
+        {
+            return 1;
+        }
+        interpreter.useMacroOpFusion(!result.count("no-fusion"));
+        interpreter.printStatsOnExit(result.count("stats"));
+
+        if (result.count("trace") &&
+            !interpreter.enableTrace(result["trace"].as<std::string>(),
+                                     result.count("flight-recorder")))
+        {
+            return 1;
+        }
+
+        if (result.count("debug")) interpreter.enableDebugger();
+        interpreter.useLowLatency(result.count("low-latency"), result.count("vsync"));
+        interpreter.measureLatency(result.count("latency"));
 
         // Run the ROM (with compatibility if specified)
         interpreter.run(result["rom"].as<std::string>(), result.count("compat"));
@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cstring>
+#include "postprocess.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define SCANLINE_WEIGHT 110 // Brightness of scanline gaps (of 255)
+#define GRILLE_WEIGHT   170 // Brightness of the two dimmed aperture channels
+
+namespace
+{
+    using u8  = PostProcessor::u8;
+    using u32 = PostProcessor::u32;
+
+    // intensity = px ? 255 : intensity * (decay + 1) / 256
+    void decayIntensity(const u8* px, u8* intensity, u8 decay, std::size_t n)
+    {
+        std::size_t i = 0;
+#ifdef USE_SSE2
+        const auto zero   = _mm_setzero_si128();
+        const auto factor = _mm_set1_epi16(short(decay + 1));
+        for (; i + 16 <= n; i += 16)
+        {
+            const auto p   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(px + i));
+            const auto cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(intensity + i));
+            const auto lo  = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(cur, zero), factor), 8);
+            const auto hi  = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(cur, zero), factor), 8);
+            const auto on  = _mm_cmpgt_epi8(p, zero);
+            const auto out = _mm_or_si128(_mm_packus_epi16(lo, hi), on);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(intensity + i), out);
+        }
+#endif
+        for (; i < n; i++)
+        {
+            intensity[i] = px[i] ? 255 : u8(intensity[i] * (decay + 1) >> 8);
+        }
+    }
+
+    // Repeats each of the n src colours scale times
+    void expandRow(const u32* src, std::size_t n, unsigned scale, u32* dst)
+    {
+        for (std::size_t i = 0; i < n; i++, dst += scale)
+        {
+            unsigned j = 0;
+#ifdef USE_SSE2
+            const auto colour = _mm_set1_epi32(int(src[i]));
+            for (; j + 4 <= scale; j += 4)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + j), colour);
+            }
+#endif
+            for (; j < scale; j++) dst[j] = src[i];
+        }
+    }
+
+    // dst = src * (weights + 1) / 256, per byte
+    void modulate(const u8* src, const u8* weights, u8* dst, std::size_t n)
+    {
+        std::size_t i = 0;
+#ifdef USE_SSE2
+        const auto zero = _mm_setzero_si128();
+        const auto one  = _mm_set1_epi16(1);
+        for (; i + 16 <= n; i += 16)
+        {
+            const auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            const auto w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + i));
+            const auto wLo = _mm_add_epi16(_mm_unpacklo_epi8(w, zero), one);
+            const auto wHi = _mm_add_epi16(_mm_unpackhi_epi8(w, zero), one);
+            const auto lo  = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), wLo), 8);
+            const auto hi  = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), wHi), 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            dst[i] = u8(src[i] * (weights[i] + 1) >> 8);
+        }
+    }
+}
+
+PostProcessor::PostProcessor(unsigned scale, Filter filter, float persistence,
+                             u32 background, u32 foreground)
+    : scale(std::max(scale, 1U)),
+      decay(u8(std::min(std::max(persistence, 0.0f), 1.0f) * 255.0f)),
+      output(SrcWidth * this->scale * SrcHeight * this->scale),
+      row(SrcWidth * this->scale),
+      profileCount(0)
+{
+    std::fill(std::begin(intensity), std::end(intensity), 0);
+    initPalette(background, foreground);
+    initProfiles(filter);
+}
+
+void PostProcessor::process(const Interpreter::FrameBuffer& frame)
+{
+    decayIntensity(frame.pixels, intensity, decay, SrcWidth * SrcHeight);
+    for (auto i = 0; i < SrcWidth * SrcHeight; i++)
+    {
+        colours[i] = palette[intensity[i]];
+    }
+
+    const auto w = width();
+    for (auto y = 0; y < SrcHeight; y++)
+    {
+        expandRow(colours + y * SrcWidth, SrcWidth, scale, row.data());
+
+        // Each distinct output row is shaded once, then copied
+        for (auto p = 0U; p < profileCount; p++)
+        {
+            modulate(reinterpret_cast<const u8*>(row.data()),
+                     profiles[p].data(),
+                     reinterpret_cast<u8*>(shaded[p].data()),
+                     w * 4);
+        }
+
+        auto dst = output.data() + y * scale * w;
+        for (auto r = 0U; r < scale; r++, dst += w)
+        {
+            const auto& src = profileCount > 0 ? shaded[rowProfile[r]] : row;
+            std::memcpy(dst, src.data(), w * sizeof(u32));
+        }
+    }
+}
+
+// RGBA, row-major, width() x height()
+const PostProcessor::u8* PostProcessor::pixels() const
+{
+    return reinterpret_cast<const u8*>(output.data());
+}
+
+unsigned PostProcessor::width() const
+{
+    return SrcWidth * scale;
+}
+
+unsigned PostProcessor::height() const
+{
+    return SrcHeight * scale;
+}
+
+bool PostProcessor::parseFilter(const std::string& name, Filter& filter)
+{
+    if (name == "nearest")  filter = Filter::Nearest;
+    else if (name == "scanline") filter = Filter::Scanline;
+    else if (name == "crt") filter = Filter::Crt;
+    else return false;
+    return true;
+}
+
+// Blend linearly from background (intensity 0) to foreground (255)
+void PostProcessor::initPalette(u32 background, u32 foreground)
+{
+    for (auto i = 0; i < 256; i++)
+    {
+        u8 rgba[4];
+        for (auto c = 0; c < 4; c++)
+        {
+            const int bg = (background >> (24 - c * 8)) & 0xFF;
+            const int fg = (foreground >> (24 - c * 8)) & 0xFF;
+            rgba[c] = u8(bg + (fg - bg) * i / 255);
+        }
+        std::memcpy(&palette[i], rgba, sizeof(rgba));
+    }
+}
+
+// Profile 0 is used for lit rows, profile 1 for scanline gaps
+void PostProcessor::initProfiles(Filter filter)
+{
+    if (filter == Filter::Nearest) return;
+
+    const auto w = width();
+    profileCount = 2;
+    for (auto p = 0; p < 2; p++)
+    {
+        const u8 rowWeight = p == 0 ? 255 : SCANLINE_WEIGHT;
+        profiles[p].resize(w * 4);
+        shaded[p].resize(w);
+
+        for (auto x = 0U; x < w; x++)
+        {
+            for (auto c = 0U; c < 4; c++)
+            {
+                // CRT: each output column favours one of R, G or B
+                const u8 grille = filter == Filter::Crt && c < 3 && x % 3 != c
+                    ? GRILLE_WEIGHT : 255;
+                const u8 weight = c == 3 ? 255 : u8(rowWeight * (grille + 1) >> 8);
+                profiles[p][x * 4 + c] = weight;
+            }
+        }
+    }
+
+    // Bottom third of each px is a gap, once there are enough rows for one
+    rowProfile.resize(scale);
+    for (auto r = 0U; r < scale; r++)
+    {
+        rowProfile[r] = scale >= 3 && r >= scale - scale / 3 ? 1 : 0;
+    }
+}
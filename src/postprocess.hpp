@@ -0,0 +1,56 @@
+#ifndef POSTPROCESS_H_
+#define POSTPROCESS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "interpreter.hpp"
+
+// CPU post-processing of the frame buffer into an RGBA image. Applies
+// phosphor persistence (per-pixel exponential decay across frames) to hide
+// XOR flicker, then upscales with the selected filter
+class PostProcessor
+{
+  public:
+    using u8  = std::uint8_t;
+    using u32 = std::uint32_t;
+
+    enum class Filter
+    {
+        Nearest,
+        Scanline, // Darken the bottom third of each pixel row
+        Crt       // Scanlines plus an RGB aperture grille
+    };
+
+    // Colours are 0xRRGGBBAA. Persistence is the fraction of a pixel's
+    // brightness kept each frame after it turns off; 0 disables blending
+    PostProcessor(unsigned scale, Filter filter, float persistence,
+                  u32 background, u32 foreground);
+    void process(const Interpreter::FrameBuffer& frame);
+    const u8* pixels() const;
+    unsigned width() const;
+    unsigned height() const;
+
+    static bool parseFilter(const std::string& name, Filter& filter);
+
+  private:
+    static constexpr auto SrcWidth  = Interpreter::FrameBuffer::Width;
+    static constexpr auto SrcHeight = Interpreter::FrameBuffer::Height;
+
+    unsigned scale;
+    u8  decay;
+    u32 palette[256];              // Colour for each intensity
+    u8  intensity[SrcWidth * SrcHeight];
+    u32 colours[SrcWidth * SrcHeight];
+    std::vector<u32> output;
+    std::vector<u32> row;          // One source row upscaled horizontally
+    std::vector<u8>  profiles[2];  // Per-byte weights for an output row
+    std::vector<u32> shaded[2];    // row with each profile applied
+    std::vector<u8>  rowProfile;   // Profile used by each row within a px
+    unsigned profileCount;
+
+    void initPalette(u32 background, u32 foreground);
+    void initProfiles(Filter filter);
+};
+
+#endif // POSTPROCESS_H_
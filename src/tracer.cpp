@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include "tracer.hpp"
+
+#define TRACE_MAGIC "C8TR"
+#define FLUSH_INTERVAL std::chrono::milliseconds(50)
+
+constexpr std::uint8_t  Tracer::NoRegister;
+constexpr std::uint16_t Tracer::Version;
+constexpr unsigned      Tracer::Capacity;
+
+Tracer::Tracer()
+    : ring(new Record[Capacity]),
+      head(0),
+      tail(0),
+      running(false),
+      droppedCount(0),
+      traceMode(Mode::Stream)
+{
+}
+
+Tracer::~Tracer()
+{
+    close();
+}
+
+bool Tracer::open(const std::string& path, Mode mode)
+{
+    close();
+
+    filePath  = path;
+    traceMode = mode;
+    head      = 0;
+    tail      = 0;
+    droppedCount = 0;
+
+    // Flight recorder files are only created when a snapshot is taken
+    if (traceMode == Mode::FlightRecorder) return true;
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        std::cerr << "Unable to open trace file '" << path << "'" << std::endl;
+        return false;
+    }
+
+    writeHeader(file);
+    running = true;
+    writer  = std::thread(&Tracer::flushLoop, this);
+    return true;
+}
+
+// Writes the most recent records to disk. Must be called from the thread
+// that records, i.e. the interpreter's
+bool Tracer::snapshot()
+{
+    if (traceMode != Mode::FlightRecorder || filePath.empty()) return false;
+
+    std::ofstream out(filePath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+    {
+        std::cerr << "Unable to open trace file '" << filePath << "'"
+                  << std::endl;
+        return false;
+    }
+
+    const auto h = head.load(std::memory_order_relaxed);
+    writeHeader(out);
+    writeRecords(out, h > Capacity ? h - Capacity : 0, h);
+    return true;
+}
+
+void Tracer::close()
+{
+    if (running)
+    {
+        running = false;
+        writer.join();
+        flush();
+
+        if (droppedCount > 0)
+        {
+            std::cerr << "Trace dropped " << droppedCount
+                      << " records; writer could not keep up" << std::endl;
+        }
+    }
+    if (file.is_open()) file.close();
+}
+
+Tracer::Mode Tracer::mode() const
+{
+    return traceMode;
+}
+
+const std::string& Tracer::path() const
+{
+    return filePath;
+}
+
+std::uint64_t Tracer::dropped() const
+{
+    return droppedCount;
+}
+
+bool Tracer::isValid(const FileHeader& header)
+{
+    return std::memcmp(header.magic, TRACE_MAGIC, 4) == 0 &&
+           header.version == Version &&
+           header.recordSize == sizeof(Record);
+}
+
+void Tracer::flushLoop()
+{
+    while (running)
+    {
+        std::this_thread::sleep_for(FLUSH_INTERVAL);
+        flush();
+    }
+}
+
+// Consumer side of the ring buffer; only runs on the writer thread, or
+// after it has been joined
+void Tracer::flush()
+{
+    const auto t = tail.load(std::memory_order_relaxed);
+    const auto h = head.load(std::memory_order_acquire);
+    if (h == t) return;
+
+    writeRecords(file, t, h);
+    file.flush();
+    tail.store(h, std::memory_order_release);
+}
+
+void Tracer::writeRecords(std::ofstream& out, std::uint64_t from, std::uint64_t to)
+{
+    // [from, to) may wrap around the end of the ring
+    while (from < to)
+    {
+        const auto start = from & (Capacity - 1);
+        const auto count = std::min<std::uint64_t>(to - from, Capacity - start);
+        out.write(reinterpret_cast<const char*>(&ring[start]),
+                  count * sizeof(Record));
+        from += count;
+    }
+}
+
+void Tracer::writeHeader(std::ofstream& out)
+{
+    FileHeader header;
+    std::memcpy(header.magic, TRACE_MAGIC, 4);
+    header.version    = Version;
+    header.recordSize = sizeof(Record);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
@@ -0,0 +1,93 @@
+#ifndef TRACER_H_
+#define TRACER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Binary execution trace. Records are written by the interpreter into a
+// single-producer/single-consumer ring buffer and either streamed to disk by
+// a background thread or, as a flight recorder, only written on request
+class Tracer
+{
+  public:
+    // Fixed-size record of one retired instruction
+    struct Record
+    {
+        std::uint32_t frame;  // Frame (60 Hz tick) the inst executed in
+        std::uint16_t pc;     // Address of the inst
+        std::uint16_t opcode;
+        std::uint16_t i;      // Register I after the inst
+        std::uint8_t  reg;    // Register written by the inst, or NoRegister
+        std::uint8_t  value;  // Value of reg after the inst
+    };
+
+    // Trace files start with this header followed by Records in host order
+    struct FileHeader
+    {
+        char magic[4];
+        std::uint16_t version;
+        std::uint16_t recordSize;
+    };
+
+    enum class Mode
+    {
+        Stream,         // Continuously flush to disk; drops records if full
+        FlightRecorder  // Keep the latest records; write on snapshot()
+    };
+
+    static constexpr std::uint8_t  NoRegister = 0xFF;
+    static constexpr std::uint16_t Version    = 1;
+    static constexpr unsigned      Capacity   = 1U << 16; // Power of two
+
+    Tracer();
+    ~Tracer();
+    bool open(const std::string& path, Mode mode);
+    void record(const Record& rec);
+    bool snapshot();
+    void close();
+    Mode mode() const;
+    const std::string& path() const;
+    std::uint64_t dropped() const;
+
+    static bool isValid(const FileHeader& header);
+
+  private:
+    std::unique_ptr<Record[]> ring;
+    std::atomic<std::uint64_t> head; // Next record to write
+    std::atomic<std::uint64_t> tail; // Next record to flush (Stream only)
+    std::atomic<bool> running;
+    std::uint64_t droppedCount;
+    std::thread writer;
+    std::ofstream file;
+    std::string filePath;
+    Mode traceMode;
+
+    void flushLoop();
+    void flush();
+    void writeRecords(std::ofstream& out, std::uint64_t from, std::uint64_t to);
+    static void writeHeader(std::ofstream& out);
+};
+
+static_assert(sizeof(Tracer::Record) == 12, "Trace records must be packed");
+
+// Called for every traced inst, so kept inline and lock-free
+inline void Tracer::record(const Record& rec)
+{
+    const auto h = head.load(std::memory_order_relaxed);
+    if (traceMode == Mode::Stream &&
+        h - tail.load(std::memory_order_acquire) >= Capacity)
+    {
+        // Writer has fallen behind; never block the interpreter
+        droppedCount++;
+        return;
+    }
+
+    ring[h & (Capacity - 1)] = rec;
+    head.store(h + 1, std::memory_order_release);
+}
+
+#endif // TRACER_H_
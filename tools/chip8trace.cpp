@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cxxopts.hpp>
+#include "tracer.hpp"
+
+#define READ_CHUNK 4096 // Records read from disk at a time
+
+using Record = Tracer::Record;
+
+struct Filter
+{
+    bool hasPc = false;
+    unsigned pc = 0;
+    unsigned opMask  = 0; // Opcode bits that must match opValue
+    unsigned opValue = 0;
+    unsigned firstFrame = 0;
+    unsigned lastFrame  = ~0U;
+
+    bool matches(const Record& rec) const
+    {
+        return (!hasPc || rec.pc == pc) &&
+               (rec.opcode & opMask) == opValue &&
+               rec.frame >= firstFrame && rec.frame <= lastFrame;
+    }
+};
+
+struct Stats
+{
+    unsigned long long records = 0;
+    unsigned firstFrame = ~0U;
+    unsigned lastFrame  = 0;
+    std::map<unsigned, unsigned long long> pcHits;
+    unsigned long long opGroups[16]{};
+    unsigned long long regWrites[16]{};
+
+    void add(const Record& rec)
+    {
+        records++;
+        firstFrame = std::min<unsigned>(firstFrame, rec.frame);
+        lastFrame  = std::max<unsigned>(lastFrame, rec.frame);
+        pcHits[rec.pc]++;
+        opGroups[rec.opcode >> 12]++;
+        if (rec.reg != Tracer::NoRegister) regWrites[rec.reg & 0xF]++;
+    }
+};
+
+// Parses a 4-digit opcode pattern such as "D01F" or "Fx33". Any non-hex
+// digit is treated as a wildcard
+bool parseOpcodePattern(const std::string& pattern, Filter& filter)
+{
+    if (pattern.size() != 4) return false;
+
+    for (auto c : pattern)
+    {
+        filter.opMask  <<= 4;
+        filter.opValue <<= 4;
+        if (std::isxdigit(static_cast<unsigned char>(c)))
+        {
+            filter.opMask  |= 0xF;
+            filter.opValue |= std::stoul(std::string(1, c), nullptr, 16);
+        }
+    }
+    return true;
+}
+
+// Parses a frame range "a:b", "a:" or ":b"
+bool parseFrameRange(const std::string& range, Filter& filter)
+{
+    const auto pos = range.find(':');
+    if (pos == std::string::npos) return false;
+
+    const auto first = range.substr(0, pos);
+    const auto last  = range.substr(pos + 1);
+    if (!first.empty()) filter.firstFrame = std::stoul(first);
+    if (!last.empty())  filter.lastFrame  = std::stoul(last);
+    return true;
+}
+
+std::string disassemble(unsigned op)
+{
+    const auto x   = (op & 0x0F00) >> 8;
+    const auto y   = (op & 0x00F0) >> 4;
+    const auto nnn =  op & 0x0FFF;
+    const auto nn  =  op & 0x00FF;
+    const auto n   =  op & 0x000F;
+
+    char text[32];
+    switch (op & 0xF000)
+    {
+    case 0x0000:
+        if (op == 0x00E0) return "CLS";
+        if (op == 0x00EE) return "RET";
+        std::snprintf(text, sizeof(text), "SYS  %03X", nnn); break;
+    case 0x1000: std::snprintf(text, sizeof(text), "JP   %03X", nnn); break;
+    case 0x2000: std::snprintf(text, sizeof(text), "CALL %03X", nnn); break;
+    case 0x3000: std::snprintf(text, sizeof(text), "SE   V%X, %02X", x, nn); break;
+    case 0x4000: std::snprintf(text, sizeof(text), "SNE  V%X, %02X", x, nn); break;
+    case 0x5000: std::snprintf(text, sizeof(text), "SE   V%X, V%X", x, y); break;
+    case 0x6000: std::snprintf(text, sizeof(text), "LD   V%X, %02X", x, nn); break;
+    case 0x7000: std::snprintf(text, sizeof(text), "ADD  V%X, %02X", x, nn); break;
+    case 0x8000:
+    {
+        static const char* const ops[16] = {
+            "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+            "?",  "?",  "?",   "?",   "?",   "?",   "SHL", "?"
+        };
+        std::snprintf(text, sizeof(text), "%-4s V%X, V%X", ops[n], x, y); break;
+    }
+    case 0x9000: std::snprintf(text, sizeof(text), "SNE  V%X, V%X", x, y); break;
+    case 0xA000: std::snprintf(text, sizeof(text), "LD   I, %03X", nnn); break;
+    case 0xB000: std::snprintf(text, sizeof(text), "JP   V0, %03X", nnn); break;
+    case 0xC000: std::snprintf(text, sizeof(text), "RND  V%X, %02X", x, nn); break;
+    case 0xD000: std::snprintf(text, sizeof(text), "DRW  V%X, V%X, %X", x, y, n); break;
+    case 0xE000:
+        if (nn == 0x9E) { std::snprintf(text, sizeof(text), "SKP  V%X", x); break; }
+        if (nn == 0xA1) { std::snprintf(text, sizeof(text), "SKNP V%X", x); break; }
+        return "?";
+    default: // 0xF000
+        switch (nn)
+        {
+        case 0x07: std::snprintf(text, sizeof(text), "LD   V%X, DT", x); break;
+        case 0x0A: std::snprintf(text, sizeof(text), "LD   V%X, K", x); break;
+        case 0x15: std::snprintf(text, sizeof(text), "LD   DT, V%X", x); break;
+        case 0x18: std::snprintf(text, sizeof(text), "LD   ST, V%X", x); break;
+        case 0x1E: std::snprintf(text, sizeof(text), "ADD  I, V%X", x); break;
+        case 0x29: std::snprintf(text, sizeof(text), "LD   F, V%X", x); break;
+        case 0x33: std::snprintf(text, sizeof(text), "LD   B, V%X", x); break;
+        case 0x55: std::snprintf(text, sizeof(text), "LD   [I], V%X", x); break;
+        case 0x65: std::snprintf(text, sizeof(text), "LD   V%X, [I]", x); break;
+        default: return "?";
+        }
+    }
+    return text;
+}
+
+void printRecord(const Record& rec)
+{
+    std::printf("%8u  %04X  %04X  %-16s I=%03X",
+        rec.frame, rec.pc, rec.opcode, disassemble(rec.opcode).c_str(), rec.i);
+    if (rec.reg != Tracer::NoRegister)
+    {
+        std::printf("  V%X=%02X", rec.reg & 0xF, rec.value);
+    }
+    std::printf("\n");
+}
+
+void printStats(const Stats& stats)
+{
+    std::printf("Records: %llu\n", stats.records);
+    if (stats.records == 0) return;
+
+    const auto frames = stats.lastFrame - stats.firstFrame + 1;
+    std::printf("Frames:  %u-%u (%.1f inst/frame)\n",
+        stats.firstFrame, stats.lastFrame, double(stats.records) / frames);
+
+    // Hottest PCs
+    std::vector<std::pair<unsigned, unsigned long long>> hot(
+        stats.pcHits.begin(), stats.pcHits.end());
+    std::sort(hot.begin(), hot.end(),
+        [](const std::pair<unsigned, unsigned long long>& a,
+           const std::pair<unsigned, unsigned long long>& b)
+        {
+            return a.second > b.second;
+        });
+
+    std::printf("Hottest PCs\n");
+    for (auto i = 0U; i < std::min<std::size_t>(hot.size(), 10); i++)
+    {
+        std::printf("  0x%04x: %llu (%.1f%%)\n", hot[i].first, hot[i].second,
+            100.0 * hot[i].second / stats.records);
+    }
+
+    std::printf("Opcode groups\n");
+    for (auto i = 0; i < 16; i++)
+    {
+        if (stats.opGroups[i] == 0) continue;
+        std::printf("  %Xnnn: %llu (%.1f%%)\n", i, stats.opGroups[i],
+            100.0 * stats.opGroups[i] / stats.records);
+    }
+
+    std::printf("Register writes\n");
+    for (auto i = 0; i < 16; i++)
+    {
+        if (stats.regWrites[i] == 0) continue;
+        std::printf("  V%x: %llu\n", i, stats.regWrites[i]);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options options(argv[0],
+        "Decode, search and summarise Chip-8 execution traces\n");
+    options.positional_help("<TRACE>");
+    options.show_positional_help();
+
+    options.add_options()
+        ("p,pc",        "Only show insts at address ADDR (hex)",
+                        cxxopts::value<std::string>(), "ADDR")
+        ("o,opcode",    "Only show insts matching PATTERN, e.g. Dxyn or Fx33",
+                        cxxopts::value<std::string>(), "PATTERN")
+        ("f,frames",    "Only show insts in frames FIRST:LAST",
+                        cxxopts::value<std::string>(), "RANGE")
+        ("n,limit",     "Show at most N matching records. Ignored with --stats",
+                        cxxopts::value<unsigned>(), "N")
+        ("s,stats",     "Print statistics instead of records")
+        ("h,help",      "Print help");
+
+    options.add_options("hidden")
+        ("trace", "Path to trace file", cxxopts::value<std::string>());
+
+    try
+    {
+        options.parse_positional({"trace"});
+        const auto result = options.parse(argc, argv);
+
+        if (result.count("help") || !result.count("trace"))
+        {
+            std::cout << options.help() << std::endl;
+            return 0;
+        }
+
+        Filter filter;
+        if (result.count("pc"))
+        {
+            filter.hasPc = true;
+            filter.pc = std::stoul(result["pc"].as<std::string>(), nullptr, 16);
+        }
+        if (result.count("opcode") &&
+            !parseOpcodePattern(result["opcode"].as<std::string>(), filter))
+        {
+            std::cerr << "Opcode pattern must be 4 digits" << std::endl;
+            return 1;
+        }
+        if (result.count("frames") &&
+            !parseFrameRange(result["frames"].as<std::string>(), filter))
+        {
+            std::cerr << "Frame range must be of the form FIRST:LAST"
+                      << std::endl;
+            return 1;
+        }
+        // Statistics always cover every matching record
+        const auto showStats = result.count("stats") > 0;
+        const auto limit = result.count("limit") && !showStats
+            ? result["limit"].as<unsigned>() : ~0U;
+
+        const auto path = result["trace"].as<std::string>();
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream.is_open())
+        {
+            std::cerr << "Unable to open trace '" << path << "'" << std::endl;
+            return 1;
+        }
+
+        Tracer::FileHeader header;
+        stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!stream || !Tracer::isValid(header))
+        {
+            std::cerr << "'" << path << "' is not a valid trace" << std::endl;
+            return 1;
+        }
+
+        Stats stats;
+        auto shown = 0U;
+        std::vector<Record> chunk(READ_CHUNK);
+        while (stream && shown < limit)
+        {
+            stream.read(reinterpret_cast<char*>(chunk.data()),
+                        chunk.size() * sizeof(Record));
+            const auto count = stream.gcount() / sizeof(Record);
+
+            for (auto i = 0U; i < count && shown < limit; i++)
+            {
+                if (!filter.matches(chunk[i])) continue;
+                showStats ? stats.add(chunk[i]) : printRecord(chunk[i]);
+                shown++;
+            }
+        }
+
+        if (showStats) printStats(stats);
+    }
+    catch (const cxxopts::OptionException& e)
+    {
+        std::cerr << "Parse error: " << e.what()
+                  << ". Use -h or --help to see valid options" << std::endl;
+        return 1;
+    }
+    catch (const std::logic_error&)
+    {
+        // Thrown by std::stoul on malformed numbers
+        std::cerr << "Invalid number. Use -h or --help to see valid options"
+                  << std::endl;
+        return 1;
+    }
+}